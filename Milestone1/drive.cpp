@@ -3,6 +3,13 @@
 #include <cassert>
 #include <cstring>
 #include <cstdio>
+#include <stdexcept>
+
+// The _s variants are MSVC-only; the format strings used here need no buffer sizes.
+#ifndef _MSC_VER
+#define sscanf_s sscanf
+#define sprintf_s snprintf
+#endif
 
 using namespace std;
 
@@ -35,28 +42,29 @@ pktdef::pktdef() : localcount(0), RawBuffer(nullptr) {
 
 // Overloaded constructor: parses a received raw data buffer.
 // 'size' is the number of bytes in the received packet.
+// Multi-byte fields are assembled from unsigned bytes so values >= 0x80 are not sign-extended.
 pktdef::pktdef(char* buffer, int size) : localcount(0), RawBuffer(nullptr) {
     if (size == PACKET_SIZE) {  // 9-byte DRIVE command packet
-        packet.header.pktcount = buffer[0] | (buffer[1] << 8);
+        packet.header.pktcount = static_cast<unsigned char>(buffer[0]) | (static_cast<unsigned char>(buffer[1]) << 8);
         packet.header.drive = (buffer[2] & 0x80) >> 7;
         packet.header.status = (buffer[2] & 0x40) >> 6;
         packet.header.sleep = (buffer[2] & 0x20) >> 5;
         packet.header.ack = (buffer[2] & 0x10) >> 4;
         packet.header.padding = (buffer[2] & 0x0F);
-        packet.header.pktlength = buffer[3] | (buffer[4] << 8);
+        packet.header.pktlength = static_cast<unsigned char>(buffer[3]) | (static_cast<unsigned char>(buffer[4]) << 8);
         packet.body.drive.direction = buffer[5];
         packet.body.drive.duration = buffer[6];
         packet.body.drive.speed = buffer[7];
         packet.crc.crc = buffer[8];
     }
     else if (size == 6) {  // 6-byte response packet (no body)
-        packet.header.pktcount = buffer[0] | (buffer[1] << 8);
+        packet.header.pktcount = static_cast<unsigned char>(buffer[0]) | (static_cast<unsigned char>(buffer[1]) << 8);
         packet.header.drive = (buffer[2] & 0x80) >> 7;
         packet.header.status = (buffer[2] & 0x40) >> 6;
         packet.header.sleep = (buffer[2] & 0x20) >> 5;
         packet.header.ack = (buffer[2] & 0x10) >> 4;
         packet.header.padding = (buffer[2] & 0x0F);
-        packet.header.pktlength = buffer[3] | (buffer[4] << 8);
+        packet.header.pktlength = static_cast<unsigned char>(buffer[3]) | (static_cast<unsigned char>(buffer[4]) << 8);
         // No body is present.
         packet.body.drive.direction = 0;
         packet.body.drive.duration = 0;
@@ -64,17 +72,17 @@ pktdef::pktdef(char* buffer, int size) : localcount(0), RawBuffer(nullptr) {
         packet.crc.crc = buffer[5];
     }
     else if (size == TELEMETRY_PACKET_SIZE) {  // 15-byte TELEMETRY response packet
-        packet.header.pktcount = buffer[0] | (buffer[1] << 8);
+        packet.header.pktcount = static_cast<unsigned char>(buffer[0]) | (static_cast<unsigned char>(buffer[1]) << 8);
         packet.header.drive = (buffer[2] & 0x80) >> 7;
         packet.header.status = (buffer[2] & 0x40) >> 6;
         packet.header.sleep = (buffer[2] & 0x20) >> 5;
         packet.header.ack = (buffer[2] & 0x10) >> 4;
         packet.header.padding = (buffer[2] & 0x0F);
-        packet.header.pktlength = buffer[3] | (buffer[4] << 8);
+        packet.header.pktlength = static_cast<unsigned char>(buffer[3]) | (static_cast<unsigned char>(buffer[4]) << 8);
         // Parse telemetry body (9 bytes)
-        packet.body.telemetry.lastPktCounter = buffer[5] | (buffer[6] << 8);
-        packet.body.telemetry.currentGrade = buffer[7] | (buffer[8] << 8);
-        packet.body.telemetry.hitCount = buffer[9] | (buffer[10] << 8);
+        packet.body.telemetry.lastPktCounter = static_cast<unsigned char>(buffer[5]) | (static_cast<unsigned char>(buffer[6]) << 8);
+        packet.body.telemetry.currentGrade = static_cast<unsigned char>(buffer[7]) | (static_cast<unsigned char>(buffer[8]) << 8);
+        packet.body.telemetry.hitCount = static_cast<unsigned char>(buffer[9]) | (static_cast<unsigned char>(buffer[10]) << 8);
         packet.body.telemetry.lastCmd = buffer[11];
         packet.body.telemetry.lastCmdValue = buffer[12];
         packet.body.telemetry.lastCmdSpeed = buffer[13];
@@ -217,6 +225,11 @@ char* pktdef::GetBodyData() {
     return buff;
 }
 
+// GetTelemetry: returns the telemetry body without formatting it as a string.
+telemetryBody pktdef::GetTelemetry() {
+    return packet.body.telemetry;
+}
+
 // GetPktCount: returns the current packet count.
 int pktdef::GetPktCount() {
     return packet.header.pktcount;
@@ -335,4 +348,8 @@ char* pktdef::GenPacket() {
 
 
 }
-int main() {}
\ No newline at end of file
+
+// Library builds (e.g. the Linux test target) provide their own entry point.
+#ifndef DRIVE_NO_MAIN
+int main() {}
+#endif
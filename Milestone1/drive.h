@@ -81,6 +81,7 @@ public:
     int GetLength();
     void SetPktCount(int count);
     char* GetBodyData();
+    telemetryBody GetTelemetry();
     int GetPktCount();
     bool CheckCRC(char* buffer, int size);
     void CalcCRC();
@@ -0,0 +1,403 @@
+#include "mux.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Default constructor: starts with an empty receive buffer.
+FrameDecoder::FrameDecoder() : start(0), end(0), dropped(0) {
+}
+
+// GetWritePtr: returns where the next read() should place its bytes.
+char* FrameDecoder::GetWritePtr() {
+    return RxBuffer + end;
+}
+
+// GetWriteSpace: returns how many bytes can be read into the buffer.
+int FrameDecoder::GetWriteSpace() {
+    return RX_BUFFER_SIZE - end;
+}
+
+// Decode: accounts for 'received' new bytes and appends every complete frame to 'out'.
+// Returns false if a header carries a length the protocol does not define, since the
+// stream can no longer be re-synchronised and the connection should be dropped.
+bool FrameDecoder::Decode(int connId, int received, vector<Frame>& out) {
+    end += received;
+    while (end - start >= HEADERSIZE) {
+        char* frame = RxBuffer + start;
+        int length = static_cast<unsigned char>(frame[3]) |
+            (static_cast<unsigned char>(frame[4]) << 8);
+        if (length != 6 && length != PACKET_SIZE && length != TELEMETRY_PACKET_SIZE)
+            return false;
+        if (end - start < length)
+            break;  // Wait for the rest of the frame.
+
+        // Same parity count as pktdef::CalcCRC, taken over the wire length.
+        int count = 0;
+        for (int i = 0; i < length - 1; i++) {
+            unsigned char byte = static_cast<unsigned char>(frame[i]);
+            for (int j = 0; j < 8; j++) {
+                count += (byte & 0x01);
+                byte >>= 1;
+            }
+        }
+        if ((count & 0xFF) == static_cast<unsigned char>(frame[length - 1])) {
+            Frame decoded = { connId, length, pktdef(frame, length) };
+            out.push_back(decoded);
+        }
+        else {
+            dropped++;
+        }
+        start += length;
+    }
+
+    // Move any partial frame to the front so the buffer never fills up.
+    if (start == end) {
+        start = 0;
+        end = 0;
+    }
+    else if (start > 0) {
+        memmove(RxBuffer, RxBuffer + start, end - start);
+        end -= start;
+        start = 0;
+    }
+    return true;
+}
+
+// GetDropped: returns the number of frames discarded for a bad CRC.
+int FrameDecoder::GetDropped() {
+    return dropped;
+}
+
+// Default constructor: an open, empty queue.
+FrameQueue::FrameQueue() : closed(false) {
+}
+
+// PushBatch: moves a whole batch into the queue under a single lock and empties 'batch'.
+void FrameQueue::PushBatch(vector<Frame>& batch) {
+    if (batch.empty())
+        return;
+    {
+        lock_guard<mutex> guard(lock);
+        if (pending.empty())
+            pending.swap(batch);
+        else
+            pending.insert(pending.end(), batch.begin(), batch.end());
+    }
+    batch.clear();
+    ready.notify_one();
+}
+
+// PopBatch: blocks until frames are available and swaps all of them into 'out'.
+// Returns false once the queue has been closed and drained.
+bool FrameQueue::PopBatch(vector<Frame>& out) {
+    unique_lock<mutex> guard(lock);
+    ready.wait(guard, [this] { return !pending.empty() || closed; });
+    out.clear();
+    if (pending.empty())
+        return false;
+    out.swap(pending);
+    return true;
+}
+
+// Open: accepts frames again after Close(), so the queue can be reused.
+void FrameQueue::Open() {
+    lock_guard<mutex> guard(lock);
+    closed = false;
+}
+
+// Close: wakes every waiting handler so it can exit once the queue is empty.
+void FrameQueue::Close() {
+    {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+    }
+    ready.notify_all();
+}
+
+#ifdef __linux__
+
+// Constructor: sets up the epoll instances and handler queues; no threads run until Start().
+ConnectionMux::ConnectionMux(int ioThreads, int handlerThreads, FrameHandler handler)
+    : handler(handler), nextIo(0), nextConnId(1), running(false) {
+    if (ioThreads < 1 || handlerThreads < 1)
+        throw std::invalid_argument("ConnectionMux needs at least one I/O and one handler thread.");
+
+    for (int i = 0; i < ioThreads; i++) {
+        IoThread* io = new IoThread();
+        io->epollFd = epoll_create1(0);
+        io->wakeFd = eventfd(0, EFD_NONBLOCK);
+        io->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        this->ioThreads.push_back(io);
+
+        // Without the wake-up event Stop() could never join this thread.
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;  // A null pointer marks the wake-up event.
+        if (io->epollFd < 0 || io->wakeFd < 0 ||
+            epoll_ctl(io->epollFd, EPOLL_CTL_ADD, io->wakeFd, &ev) < 0) {
+            // The destructor will not run, so release everything built so far.
+            for (IoThread* built : this->ioThreads)
+                ReleaseIo(built);
+            this->ioThreads.clear();
+            throw std::runtime_error("Unable to create epoll instance.");
+        }
+    }
+    for (int i = 0; i < handlerThreads; i++)
+        queues.push_back(new FrameQueue());
+}
+
+// Destructor: stops the threads and releases every connection still open.
+ConnectionMux::~ConnectionMux() {
+    Stop();
+    for (IoThread* io : ioThreads)
+        ReleaseIo(io);
+    for (FrameQueue* queue : queues)
+        delete queue;
+}
+
+// ReleaseIo: closes an I/O thread's connections and descriptors and frees it.
+void ConnectionMux::ReleaseIo(IoThread* io) {
+    for (Connection* conn : io->connections) {
+        close(conn->fd);
+        delete conn;
+    }
+    if (io->spareFd >= 0)
+        close(io->spareFd);
+    if (io->wakeFd >= 0)
+        close(io->wakeFd);
+    if (io->epollFd >= 0)
+        close(io->epollFd);
+    delete io;
+}
+
+// Start: launches the handler threads and then the epoll threads.
+void ConnectionMux::Start() {
+    if (running)
+        return;
+    running = true;
+    for (FrameQueue* queue : queues)
+        queue->Open();
+    for (FrameQueue* queue : queues)
+        handlers.push_back(thread(&ConnectionMux::RunHandler, this, queue));
+    for (IoThread* io : ioThreads)
+        io->worker = thread(&ConnectionMux::RunIo, this, io);
+}
+
+// Stop: wakes and joins the epoll threads, then lets the handlers finish queued frames.
+void ConnectionMux::Stop() {
+    if (!running)
+        return;
+    running = false;
+    for (IoThread* io : ioThreads) {
+        uint64_t one = 1;
+        if (write(io->wakeFd, &one, sizeof(one)) < 0)
+            cout << "Unable to wake I/O thread" << endl;
+    }
+    for (IoThread* io : ioThreads)
+        io->worker.join();
+    for (FrameQueue* queue : queues)
+        queue->Close();
+    for (thread& worker : handlers)
+        worker.join();
+    handlers.clear();
+}
+
+// AddListener: watches a listening socket and adopts every connection accepted on it.
+// On success the mux owns 'fd' and closes it in the destructor; on failure the caller keeps it.
+bool ConnectionMux::AddListener(int fd) {
+    return Register(fd, true) >= 0;
+}
+
+// AddConnection: switches 'fd' to non-blocking mode and starts decoding frames from it.
+// On success the mux owns 'fd' and closes it with the connection; the caller must not close it.
+// Returns the connection id its frames will carry, or -1 on failure, in which case the caller keeps 'fd'.
+int ConnectionMux::AddConnection(int fd) {
+    return Register(fd, false);
+}
+
+// GetConnectionCount: returns the number of open connections, excluding listeners.
+int ConnectionMux::GetConnectionCount() {
+    int count = 0;
+    for (IoThread* io : ioThreads) {
+        lock_guard<mutex> guard(io->lock);
+        for (Connection* conn : io->connections) {
+            if (!conn->listener)
+                count++;
+        }
+    }
+    return count;
+}
+
+// Register: assigns the descriptor to an epoll thread in round-robin order.
+// Ids only go up, so a descriptor number reused by the kernel gets a fresh id.
+int ConnectionMux::Register(int fd, bool listener) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    IoThread* io;
+    int id;
+    {
+        lock_guard<mutex> guard(registerLock);
+        io = ioThreads[nextIo++ % ioThreads.size()];
+        id = nextConnId++;
+    }
+
+    Connection* conn = new Connection();
+    conn->id = id;
+    conn->fd = fd;
+    conn->listener = listener;
+    {
+        lock_guard<mutex> guard(io->lock);
+        io->connections.push_back(conn);
+    }
+
+    // Edge-triggered: Drain() always reads until EAGAIN.
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    if (epoll_ctl(io->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        lock_guard<mutex> guard(io->lock);
+        io->connections.erase(find(io->connections.begin(), io->connections.end(), conn));
+        delete conn;
+        return -1;
+    }
+    return id;
+}
+
+// RunIo: epoll loop for one I/O thread.
+void ConnectionMux::RunIo(IoThread* io) {
+    epoll_event events[MAX_EVENTS];
+    vector<vector<Frame>> batches(queues.size());
+
+    bool stopping = false;
+    while (!stopping) {
+        int ready = epoll_wait(io->epollFd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            cout << "epoll_wait failed" << endl;
+            return;
+        }
+        for (int i = 0; i < ready; i++) {
+            Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+            if (conn == nullptr) {
+                // Only Stop() writes the eventfd. Reset it for a later Start(), but finish
+                // this array first: edge-triggered events are not reported twice.
+                uint64_t value;
+                if (read(io->wakeFd, &value, sizeof(value)) < 0)
+                    cout << "Unable to reset wake-up event" << endl;
+                stopping = true;
+                continue;
+            }
+            if (conn->listener) {
+                Accept(io, conn);
+                continue;
+            }
+            bool open = Drain(conn, batches);
+            if (!open || (events[i].events & (EPOLLERR | EPOLLHUP)))
+                CloseConnection(io, conn, batches);
+        }
+        // Hand off partial batches once per wakeup so no frame waits on a quiet link.
+        Flush(batches, true);
+    }
+}
+
+// RunHandler: delivers each batch from one queue to the user handler.
+void ConnectionMux::RunHandler(FrameQueue* queue) {
+    vector<Frame> batch;
+    while (queue->PopBatch(batch)) {
+        for (Frame& frame : batch)
+            handler(frame);
+    }
+}
+
+// Accept: adopts every pending connection on a listening socket.
+// The listener is edge-triggered, so the backlog must be drained here; a client
+// that cannot get a descriptor is accepted on the spare one and closed at once.
+void ConnectionMux::Accept(IoThread* io, Connection* conn) {
+    for (;;) {
+        int fd = accept4(conn->fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if ((errno == EMFILE || errno == ENFILE) && io->spareFd >= 0) {
+                close(io->spareFd);
+                fd = accept(conn->fd, nullptr, nullptr);
+                if (fd >= 0)
+                    close(fd);
+                io->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (fd >= 0)
+                    continue;
+            }
+            return;  // EAGAIN: backlog drained.
+        }
+        if (AddConnection(fd) < 0)
+            close(fd);
+    }
+}
+
+// Drain: reads until the descriptor would block, routing frames to handler batches.
+// A connection always maps to the same handler so its frames stay in order.
+// Returns false when the peer closed the connection or sent an undecodable stream.
+bool ConnectionMux::Drain(Connection* conn, vector<vector<Frame>>& batches) {
+    vector<Frame>& batch = batches[conn->id % batches.size()];
+    for (;;) {
+        ssize_t received = read(conn->fd, conn->decoder.GetWritePtr(), conn->decoder.GetWriteSpace());
+        if (received == 0)
+            return false;
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (!conn->decoder.Decode(conn->id, static_cast<int>(received), batch))
+            return false;
+        if (static_cast<int>(batch.size()) >= BATCH_SIZE)
+            Flush(batches, false);
+    }
+}
+
+// Flush: pushes full batches (or every non-empty batch when 'partial' is set) to their queues.
+void ConnectionMux::Flush(vector<vector<Frame>>& batches, bool partial) {
+    for (size_t i = 0; i < batches.size(); i++) {
+        if (batches[i].empty())
+            continue;
+        if (partial || static_cast<int>(batches[i].size()) >= BATCH_SIZE)
+            queues[i]->PushBatch(batches[i]);
+    }
+}
+
+// CloseConnection: unregisters and closes a connection owned by this I/O thread.
+// The close event follows the connection's frames through the same handler queue.
+void ConnectionMux::CloseConnection(IoThread* io, Connection* conn, vector<vector<Frame>>& batches) {
+    epoll_ctl(io->epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    close(conn->fd);
+    Frame closed = { conn->id, CLOSE_EVENT, pktdef() };
+    batches[conn->id % batches.size()].push_back(closed);
+    {
+        lock_guard<mutex> guard(io->lock);
+        for (size_t i = 0; i < io->connections.size(); i++) {
+            if (io->connections[i] == conn) {
+                io->connections[i] = io->connections.back();
+                io->connections.pop_back();
+                break;
+            }
+        }
+    }
+    delete conn;
+}
+
+#endif
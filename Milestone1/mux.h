@@ -0,0 +1,125 @@
+#pragma once
+
+#include "drive.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Constant definitions
+const int RX_BUFFER_SIZE = 512;     // Per-connection receive buffer (bytes)
+const int MAX_EVENTS = 256;         // epoll events drained per wakeup
+const int BATCH_SIZE = 64;          // Frames handed to a handler thread per lock
+const int CLOSE_EVENT = 0;          // Frame length marking a closed connection
+
+// A decoded packet tagged with the connection it arrived on.
+// When a connection closes, one last Frame with length CLOSE_EVENT and an
+// empty packet is delivered after all of its other frames.
+struct Frame {
+    int connId;     // Assigned by ConnectionMux, never reused
+    int length;     // Wire length taken from pktlength (6, 9 or 15), or CLOSE_EVENT
+    pktdef packet;
+};
+
+// Called on a handler thread for every decoded frame and close event.
+typedef std::function<void(Frame& frame)> FrameHandler;
+
+// Declaration of the FrameDecoder class.
+// Holds one connection's receive buffer and splits the byte stream into
+// frames using the pktlength field of each header.
+class FrameDecoder {
+public:
+    FrameDecoder();
+
+    // Member functions
+    char* GetWritePtr();
+    int GetWriteSpace();
+    bool Decode(int connId, int received, std::vector<Frame>& out);
+    int GetDropped();
+
+private:
+    char RxBuffer[RX_BUFFER_SIZE];
+    int start;      // First unconsumed byte
+    int end;        // One past the last received byte
+    int dropped;    // Frames discarded for a bad CRC
+};
+
+// Declaration of the FrameQueue class.
+// Hands frames from the I/O threads to one handler thread a batch at a time,
+// so the lock is taken once per batch instead of once per frame.
+class FrameQueue {
+public:
+    FrameQueue();
+
+    // Member functions
+    void PushBatch(std::vector<Frame>& batch);
+    bool PopBatch(std::vector<Frame>& out);
+    void Open();
+    void Close();
+
+private:
+    std::mutex lock;
+    std::condition_variable ready;
+    std::vector<Frame> pending;
+    bool closed;
+};
+
+#ifdef __linux__
+
+// Declaration of the ConnectionMux class.
+// Spreads non-blocking connections (sockets, ptys or serial ports) across a
+// few epoll threads and dispatches decoded frames to handler threads.
+// A descriptor passed to AddConnection() or AddListener() is owned by the mux
+// once the call succeeds: the mux closes it when the peer goes away, when the
+// stream cannot be decoded, or in the destructor. Callers must not close it.
+class ConnectionMux {
+public:
+    // Constructors
+    ConnectionMux(int ioThreads, int handlerThreads, FrameHandler handler);
+    ~ConnectionMux();
+
+    // Member functions
+    void Start();
+    void Stop();
+    bool AddListener(int fd);
+    int AddConnection(int fd);
+    int GetConnectionCount();
+
+private:
+    struct Connection {
+        int id;
+        int fd;
+        bool listener;
+        FrameDecoder decoder;
+    };
+
+    struct IoThread {
+        int epollFd;
+        int wakeFd;     // eventfd used to interrupt epoll_wait on Stop()
+        int spareFd;    // Held in reserve so clients can be shed when out of descriptors
+        std::thread worker;
+        std::mutex lock;
+        std::vector<Connection*> connections;
+    };
+
+    int Register(int fd, bool listener);
+    static void ReleaseIo(IoThread* io);
+    void RunIo(IoThread* io);
+    void RunHandler(FrameQueue* queue);
+    void Accept(IoThread* io, Connection* conn);
+    bool Drain(Connection* conn, std::vector<std::vector<Frame>>& batches);
+    void Flush(std::vector<std::vector<Frame>>& batches, bool partial);
+    void CloseConnection(IoThread* io, Connection* conn, std::vector<std::vector<Frame>>& batches);
+
+    FrameHandler handler;
+    std::vector<IoThread*> ioThreads;
+    std::vector<FrameQueue*> queues;
+    std::vector<std::thread> handlers;
+    std::mutex registerLock;
+    unsigned int nextIo;
+    int nextConnId;
+    bool running;
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "telemetry.h"
+#include <stdexcept>
+
+using namespace std;
+
+// Default constructor: no queries are registered.
+TelemetryEngine::TelemetryEngine() {
+}
+
+// AddQuery: registers a standing query and returns its id.
+// 'window' is the number of most recent frames the condition looks at.
+int TelemetryEngine::AddQuery(telemetryField field, queryType type, int window, int threshold, AlertCallback callback) {
+    if (window < 1)
+        throw std::invalid_argument("Query window must hold at least one frame.");
+    if ((type == INCREASE_ABOVE || type == DECREASE_ABOVE) && window < 2)
+        throw std::invalid_argument("Change queries need a window of at least two frames.");
+
+    // Hold every shard so no frame is evaluated while the query list grows.
+    for (int i = 0; i < TELEMETRY_SHARDS; i++)
+        shards[i].lock.lock();
+    Query query = { field, type, window, threshold, true, callback };
+    queries.push_back(query);
+    int queryId = static_cast<int>(queries.size()) - 1;
+    for (int i = TELEMETRY_SHARDS - 1; i >= 0; i--)
+        shards[i].lock.unlock();
+    return queryId;
+}
+
+// RemoveQuery: stops evaluating a query; its id is not reused.
+void TelemetryEngine::RemoveQuery(int queryId) {
+    for (int i = 0; i < TELEMETRY_SHARDS; i++)
+        shards[i].lock.lock();
+    if (queryId >= 0 && queryId < static_cast<int>(queries.size()))
+        queries[queryId].active = false;
+    for (int i = TELEMETRY_SHARDS - 1; i >= 0; i--)
+        shards[i].lock.unlock();
+}
+
+// OnTelemetry: slides every query window for 'robotId' forward by one frame and
+// fires the callbacks of queries that tripped. Callbacks run after the robot's
+// shard is released, so they may call back into the engine.
+void TelemetryEngine::OnTelemetry(int robotId, const telemetryBody& body) {
+    vector<pair<Query*, Alert>> fired;
+    Shard& shard = shards[static_cast<unsigned int>(robotId) % TELEMETRY_SHARDS];
+    {
+        lock_guard<mutex> guard(shard.lock);
+        vector<Window>& windows = shard.robots[robotId];
+        while (windows.size() < queries.size()) {
+            Window window = { vector<int>(queries[windows.size()].window, 0), 0, 0, 0, false };
+            windows.push_back(window);
+        }
+
+        for (size_t i = 0; i < queries.size(); i++) {
+            Query& query = queries[i];
+            if (!query.active)
+                continue;
+            Window& window = windows[i];
+            int value = GetField(body, query.field);
+
+            // Replace the oldest value with the newest one.
+            if (window.count == query.window)
+                window.sum -= window.values[window.head];
+            else
+                window.count++;
+            window.values[window.head] = value;
+            window.sum += value;
+            window.head = (window.head + 1) % query.window;
+
+            // Until the ring is full the oldest value still sits in slot 0.
+            int oldest = window.values[window.count == query.window ? window.head : 0];
+            // Averages compare sum against threshold * count so a fractional mean is not
+            // truncated; the rounded-down mean is only reported in the alert.
+            long long limit = static_cast<long long>(query.threshold) * window.count;
+            int average = static_cast<int>(window.sum / window.count);
+            int measured = 0;
+            bool hit = false;
+            switch (query.type) {
+            case INCREASE_ABOVE:
+                measured = GetChange(query.field, oldest, value);
+                hit = measured > query.threshold;
+                break;
+            case DECREASE_ABOVE:
+                measured = -GetChange(query.field, oldest, value);
+                hit = measured > query.threshold;
+                break;
+            case VALUE_BELOW:
+                measured = value;
+                hit = measured < query.threshold;
+                break;
+            case VALUE_ABOVE:
+                measured = value;
+                hit = measured > query.threshold;
+                break;
+            case AVERAGE_BELOW:
+                measured = average;
+                hit = window.count == query.window && window.sum < limit;
+                break;
+            case AVERAGE_ABOVE:
+                measured = average;
+                hit = window.count == query.window && window.sum > limit;
+                break;
+            }
+
+            if (hit && !window.tripped) {
+                Alert alert = { static_cast<int>(i), robotId, body.lastPktCounter, measured };
+                fired.push_back(make_pair(&query, alert));
+            }
+            window.tripped = hit;
+        }
+    }
+
+    for (size_t i = 0; i < fired.size(); i++)
+        fired[i].first->callback(fired[i].second);
+}
+
+// OnFrame: feeds a frame from ConnectionMux into the engine, using the connection as the robot.
+// A close event discards the robot's windows; other non-telemetry frames are ignored.
+void TelemetryEngine::OnFrame(Frame& frame) {
+    if (frame.length == CLOSE_EVENT) {
+        ResetRobot(frame.connId);
+        return;
+    }
+    if (frame.length != TELEMETRY_PACKET_SIZE || frame.packet.GetCmd() != RESPONSE)
+        return;
+    OnTelemetry(frame.connId, frame.packet.GetTelemetry());
+}
+
+// ResetRobot: discards a robot's windows and tripped flags, e.g. when it disconnects.
+void TelemetryEngine::ResetRobot(int robotId) {
+    Shard& shard = shards[static_cast<unsigned int>(robotId) % TELEMETRY_SHARDS];
+    lock_guard<mutex> guard(shard.lock);
+    shard.robots.erase(robotId);
+}
+
+// GetChange: returns newest - oldest. Counter fields wrap at 16 bits, so their
+// difference is folded into -32768..32767 instead of jumping on a rollover.
+int TelemetryEngine::GetChange(telemetryField field, int oldest, int newest) {
+    int change = newest - oldest;
+    if (field == LAST_PKT_COUNTER || field == HIT_COUNT) {
+        change &= 0xFFFF;
+        if (change >= 0x8000)
+            change -= 0x10000;
+    }
+    return change;
+}
+
+// GetField: returns the telemetry field a query watches.
+int TelemetryEngine::GetField(const telemetryBody& body, telemetryField field) {
+    switch (field) {
+    case LAST_PKT_COUNTER:
+        return body.lastPktCounter;
+    case CURRENT_GRADE:
+        return body.currentGrade;
+    case HIT_COUNT:
+        return body.hitCount;
+    case LAST_CMD:
+        return body.lastCmd;
+    case LAST_CMD_VALUE:
+        return body.lastCmdValue;
+    case LAST_CMD_SPEED:
+        return body.lastCmdSpeed;
+    default:
+        return 0;
+    }
+}
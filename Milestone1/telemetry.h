@@ -0,0 +1,91 @@
+#pragma once
+
+#include "drive.h"
+#include "mux.h"
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Constant definitions
+const int TELEMETRY_SHARDS = 16;    // Robots are spread across this many locks
+
+// Telemetry fields a query can watch.
+enum telemetryField {
+    LAST_PKT_COUNTER,
+    CURRENT_GRADE,
+    HIT_COUNT,
+    LAST_CMD,
+    LAST_CMD_VALUE,
+    LAST_CMD_SPEED
+};
+
+// Conditions a query can test over its window of the last N frames.
+// Changes in the 16-bit counters (lastPktCounter, hitCount) are taken modulo
+// 2^16, so a rollover from 65535 to 0 counts as an increase of one.
+enum queryType {
+    INCREASE_ABOVE,     // newest - oldest value in the window > threshold
+    DECREASE_ABOVE,     // oldest - newest value in the window > threshold
+    VALUE_BELOW,        // newest value < threshold
+    VALUE_ABOVE,        // newest value > threshold
+    AVERAGE_BELOW,      // mean of the window < threshold
+    AVERAGE_ABOVE       // mean of the window > threshold
+};
+
+// Passed to a query's callback when it trips.
+struct Alert {
+    int queryId;
+    int robotId;
+    int pktCount;   // lastPktCounter of the frame that tripped the query
+    int value;      // The delta, value or average that crossed the threshold
+};
+
+typedef std::function<void(const Alert& alert)> AlertCallback;
+
+// Declaration of the TelemetryEngine class.
+// Evaluates standing queries against every telemetry frame as it arrives.
+// Each robot keeps a running window per query, so a frame costs O(queries)
+// regardless of the window length. A query fires once when its condition
+// becomes true and re-arms when it becomes false again.
+class TelemetryEngine {
+public:
+    TelemetryEngine();
+
+    // Member functions
+    int AddQuery(telemetryField field, queryType type, int window, int threshold, AlertCallback callback);
+    void RemoveQuery(int queryId);
+    void OnTelemetry(int robotId, const telemetryBody& body);
+    void OnFrame(Frame& frame);
+    void ResetRobot(int robotId);
+
+private:
+    struct Query {
+        telemetryField field;
+        queryType type;
+        int window;
+        int threshold;
+        bool active;
+        AlertCallback callback;
+    };
+
+    // Sliding window of one query for one robot.
+    struct Window {
+        std::vector<int> values;    // Ring buffer of the last 'window' values
+        int head;                   // Next slot to overwrite
+        int count;
+        long long sum;
+        bool tripped;
+    };
+
+    struct Shard {
+        std::mutex lock;
+        std::unordered_map<int, std::vector<Window>> robots;
+    };
+
+    static int GetField(const telemetryBody& body, telemetryField field);
+    static int GetChange(telemetryField field, int oldest, int newest);
+
+    std::deque<Query> queries;      // Never shrinks, so references stay valid
+    Shard shards[TELEMETRY_SHARDS];
+};
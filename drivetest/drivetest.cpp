@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "CppUnitTest.h"
 #include "drive.h"
+#include "mux.h"
+#include "telemetry.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
@@ -234,4 +236,294 @@ namespace drivetest
             delete[] buf;
         }
     };
+
+    TEST_CLASS(framedecodertest)
+    {
+    public:
+
+        // Test that a frame split across two reads is only emitted once complete.
+        TEST_METHOD(DecodeSplitFrameTest)
+        {
+            pktdef packet;
+            packet.SetPktCount(1);
+            packet.SetCmd(DRIVE);
+            char driveInput[] = "1,10,90";
+            packet.SetBodyData(driveInput, sizeof(driveInput));
+            char* buf = packet.GenPacket();
+
+            FrameDecoder decoder;
+            std::vector<Frame> frames;
+            memcpy(decoder.GetWritePtr(), buf, 4);
+            Assert::IsTrue(decoder.Decode(7, 4, frames));
+            Assert::AreEqual(0, (int)frames.size());
+            memcpy(decoder.GetWritePtr(), buf + 4, PACKET_SIZE - 4);
+            Assert::IsTrue(decoder.Decode(7, PACKET_SIZE - 4, frames));
+            Assert::AreEqual(1, (int)frames.size());
+            Assert::AreEqual(7, frames[0].connId);
+            Assert::AreEqual(PACKET_SIZE, frames[0].length);
+            Assert::AreEqual(DRIVE, frames[0].packet.GetCmd());
+            char* body = frames[0].packet.GetBodyData();
+            Assert::AreEqual(std::string("1,10,90"), std::string(body));
+            delete[] body;
+            delete[] buf;
+        }
+
+        // Test that back-to-back frames of different lengths are split by pktlength.
+        TEST_METHOD(DecodeMixedFramesTest)
+        {
+            pktdef sleep;
+            sleep.SetPktCount(2);
+            sleep.SetCmd(SLEEP);
+            char* sleepBuf = sleep.GenPacket();
+
+            pktdef telemetry;
+            telemetry.SetPktCount(3);
+            telemetry.SetCmd(RESPONSE);
+            char telemetryInput[] = "5,95,3,1,10,80";
+            telemetry.SetBodyData(telemetryInput, sizeof(telemetryInput));
+            char* telemetryBuf = telemetry.GenPacket();
+
+            FrameDecoder decoder;
+            std::vector<Frame> frames;
+            memcpy(decoder.GetWritePtr(), sleepBuf, 6);
+            memcpy(decoder.GetWritePtr() + 6, telemetryBuf, TELEMETRY_PACKET_SIZE);
+            Assert::IsTrue(decoder.Decode(1, 6 + TELEMETRY_PACKET_SIZE, frames));
+            Assert::AreEqual(2, (int)frames.size());
+            Assert::AreEqual(6, frames[0].length);
+            Assert::AreEqual(SLEEP, frames[0].packet.GetCmd());
+            Assert::AreEqual(TELEMETRY_PACKET_SIZE, frames[1].length);
+            Assert::AreEqual(3, frames[1].packet.GetPktCount());
+            delete[] sleepBuf;
+            delete[] telemetryBuf;
+        }
+
+        // Test that a corrupted CRC drops the frame but keeps the stream.
+        TEST_METHOD(DecodeBadCRCTest)
+        {
+            pktdef packet;
+            packet.SetPktCount(4);
+            packet.SetCmd(SLEEP);
+            char* buf = packet.GenPacket();
+            buf[5] ^= 0x01;
+
+            FrameDecoder decoder;
+            std::vector<Frame> frames;
+            memcpy(decoder.GetWritePtr(), buf, 6);
+            Assert::IsTrue(decoder.Decode(1, 6, frames));
+            Assert::AreEqual(0, (int)frames.size());
+            Assert::AreEqual(1, decoder.GetDropped());
+            delete[] buf;
+        }
+
+        // Test that header and body bytes >= 0x80 are not sign-extended.
+        TEST_METHOD(DecodeHighByteTest)
+        {
+            pktdef packet;
+            packet.SetPktCount(200);
+            packet.SetCmd(RESPONSE);
+            char telemetryInput[] = "300,200,40000,1,10,200";
+            packet.SetBodyData(telemetryInput, sizeof(telemetryInput));
+            char* buf = packet.GenPacket();
+
+            FrameDecoder decoder;
+            std::vector<Frame> frames;
+            memcpy(decoder.GetWritePtr(), buf, TELEMETRY_PACKET_SIZE);
+            Assert::IsTrue(decoder.Decode(1, TELEMETRY_PACKET_SIZE, frames));
+            Assert::AreEqual(1, (int)frames.size());
+            Assert::AreEqual(200, frames[0].packet.GetPktCount());
+            char* body = frames[0].packet.GetBodyData();
+            Assert::AreEqual(std::string("300,200,40000,1,10,200"), std::string(body));
+            delete[] body;
+            delete[] buf;
+        }
+
+        // Test that an undefined pktlength is reported as a framing error.
+        TEST_METHOD(DecodeBadLengthTest)
+        {
+            char raw[HEADERSIZE] = { 1, 0, 0, 42, 0 };
+            FrameDecoder decoder;
+            std::vector<Frame> frames;
+            memcpy(decoder.GetWritePtr(), raw, HEADERSIZE);
+            Assert::IsFalse(decoder.Decode(1, HEADERSIZE, frames));
+        }
+
+        // Test that a batch is handed off whole and the queue reports closure.
+        TEST_METHOD(FrameQueueBatchTest)
+        {
+            FrameQueue queue;
+            std::vector<Frame> batch;
+            for (int i = 0; i < 3; i++) {
+                Frame frame = { i, 6, pktdef() };
+                batch.push_back(frame);
+            }
+            queue.PushBatch(batch);
+            Assert::AreEqual(0, (int)batch.size());
+
+            std::vector<Frame> out;
+            Assert::IsTrue(queue.PopBatch(out));
+            Assert::AreEqual(3, (int)out.size());
+            Assert::AreEqual(2, out[2].connId);
+
+            queue.Close();
+            Assert::IsFalse(queue.PopBatch(out));
+        }
+    };
+
+    TEST_CLASS(telemetryenginetest)
+    {
+    public:
+
+        static telemetryBody MakeTelemetry(int pktCounter, int grade, int hits)
+        {
+            telemetryBody body = {};
+            body.lastPktCounter = pktCounter;
+            body.currentGrade = grade;
+            body.hitCount = hits;
+            return body;
+        }
+
+        // Test that an increase over the window fires once and re-arms.
+        TEST_METHOD(IncreaseAboveTest)
+        {
+            TelemetryEngine engine;
+            std::vector<Alert> alerts;
+            int id = engine.AddQuery(HIT_COUNT, INCREASE_ABOVE, 3, 4,
+                [&](const Alert& alert) { alerts.push_back(alert); });
+
+            engine.OnTelemetry(1, MakeTelemetry(1, 100, 0));
+            engine.OnTelemetry(1, MakeTelemetry(2, 100, 2));
+            engine.OnTelemetry(1, MakeTelemetry(3, 100, 5));   // 5 - 0 > 4
+            Assert::AreEqual(1, (int)alerts.size());
+            Assert::AreEqual(id, alerts[0].queryId);
+            Assert::AreEqual(1, alerts[0].robotId);
+            Assert::AreEqual(3, alerts[0].pktCount);
+            Assert::AreEqual(5, alerts[0].value);
+
+            engine.OnTelemetry(1, MakeTelemetry(4, 100, 6));   // 6 - 2, re-arms
+            engine.OnTelemetry(1, MakeTelemetry(5, 100, 6));   // 6 - 5
+            engine.OnTelemetry(1, MakeTelemetry(6, 100, 12));  // 12 - 6 > 4
+            Assert::AreEqual(2, (int)alerts.size());
+            Assert::AreEqual(6, alerts[1].value);
+        }
+
+        // Test that a threshold query fires on the falling edge only.
+        TEST_METHOD(ValueBelowTest)
+        {
+            TelemetryEngine engine;
+            int fired = 0;
+            engine.AddQuery(CURRENT_GRADE, VALUE_BELOW, 1, 50,
+                [&](const Alert&) { fired++; });
+
+            engine.OnTelemetry(2, MakeTelemetry(1, 80, 0));
+            engine.OnTelemetry(2, MakeTelemetry(2, 40, 0));
+            engine.OnTelemetry(2, MakeTelemetry(3, 30, 0));
+            Assert::AreEqual(1, fired);
+            engine.OnTelemetry(2, MakeTelemetry(4, 60, 0));
+            engine.OnTelemetry(2, MakeTelemetry(5, 45, 0));
+            Assert::AreEqual(2, fired);
+        }
+
+        // Test that averages only fire over a full window and robots are tracked separately.
+        TEST_METHOD(AverageBelowTest)
+        {
+            TelemetryEngine engine;
+            std::vector<Alert> alerts;
+            engine.AddQuery(CURRENT_GRADE, AVERAGE_BELOW, 4, 50,
+                [&](const Alert& alert) { alerts.push_back(alert); });
+
+            engine.OnTelemetry(3, MakeTelemetry(1, 10, 0));
+            engine.OnTelemetry(4, MakeTelemetry(1, 90, 0));
+            engine.OnTelemetry(3, MakeTelemetry(2, 10, 0));
+            engine.OnTelemetry(3, MakeTelemetry(3, 10, 0));
+            Assert::AreEqual(0, (int)alerts.size());
+            engine.OnTelemetry(3, MakeTelemetry(4, 90, 0));    // (10 + 10 + 10 + 90) / 4
+            Assert::AreEqual(1, (int)alerts.size());
+            Assert::AreEqual(3, alerts[0].robotId);
+            Assert::AreEqual(30, alerts[0].value);
+        }
+
+        // Test that a fractional mean just past the threshold still fires.
+        TEST_METHOD(AverageFractionalTest)
+        {
+            TelemetryEngine engine;
+            std::vector<Alert> highs;
+            int lows = 0;
+            engine.AddQuery(CURRENT_GRADE, AVERAGE_ABOVE, 2, 50,
+                [&](const Alert& alert) { highs.push_back(alert); });
+            engine.AddQuery(CURRENT_GRADE, AVERAGE_BELOW, 2, 50,
+                [&](const Alert&) { lows++; });
+
+            engine.OnTelemetry(7, MakeTelemetry(1, 50, 0));
+            engine.OnTelemetry(7, MakeTelemetry(2, 51, 0));    // mean 50.5
+            Assert::AreEqual(1, (int)highs.size());
+            Assert::AreEqual(50, highs[0].value);
+            Assert::AreEqual(0, lows);
+
+            engine.OnTelemetry(7, MakeTelemetry(3, 48, 0));    // mean 49.5
+            Assert::AreEqual(1, lows);
+        }
+
+        // Test that a 16-bit counter rollover is an increase, not a drop.
+        TEST_METHOD(CounterRolloverTest)
+        {
+            TelemetryEngine engine;
+            std::vector<Alert> rises;
+            int drops = 0;
+            engine.AddQuery(HIT_COUNT, INCREASE_ABOVE, 2, 4,
+                [&](const Alert& alert) { rises.push_back(alert); });
+            engine.AddQuery(HIT_COUNT, DECREASE_ABOVE, 2, 4,
+                [&](const Alert&) { drops++; });
+
+            engine.OnTelemetry(6, MakeTelemetry(1, 100, 65533));
+            engine.OnTelemetry(6, MakeTelemetry(2, 100, 2));   // 65533 -> 2 is +5
+            Assert::AreEqual(0, drops);
+            Assert::AreEqual(1, (int)rises.size());
+            Assert::AreEqual(5, rises[0].value);
+        }
+
+        // Test that a close event clears the windows so a reconnect starts fresh.
+        TEST_METHOD(CloseEventResetTest)
+        {
+            TelemetryEngine engine;
+            int drops = 0;
+            int lows = 0;
+            engine.AddQuery(HIT_COUNT, DECREASE_ABOVE, 2, 10,
+                [&](const Alert&) { drops++; });
+            engine.AddQuery(CURRENT_GRADE, VALUE_BELOW, 1, 50,
+                [&](const Alert&) { lows++; });
+
+            engine.OnTelemetry(5, MakeTelemetry(1, 40, 500));
+            Assert::AreEqual(1, lows);
+
+            Frame closed = { 5, CLOSE_EVENT, pktdef() };
+            engine.OnFrame(closed);
+
+            // Same id, new session: no drop from the old hitCount, and a low grade fires again.
+            engine.OnTelemetry(5, MakeTelemetry(1, 40, 0));
+            Assert::AreEqual(0, drops);
+            Assert::AreEqual(2, lows);
+        }
+
+        // Test that removed queries stop firing and frames are read from pktdef.
+        TEST_METHOD(RemoveQueryAndFrameTest)
+        {
+            TelemetryEngine engine;
+            int fired = 0;
+            int id = engine.AddQuery(CURRENT_GRADE, VALUE_BELOW, 1, 96,
+                [&](const Alert&) { fired++; });
+
+            pktdef packet;
+            packet.SetCmd(RESPONSE);
+            char telemetryInput[] = "5,95,3,1,10,80";
+            packet.SetBodyData(telemetryInput, sizeof(telemetryInput));
+            Frame frame = { 9, TELEMETRY_PACKET_SIZE, packet };
+            engine.OnFrame(frame);
+            Assert::AreEqual(1, fired);
+
+            engine.RemoveQuery(id);
+            engine.ResetRobot(9);
+            engine.OnFrame(frame);
+            Assert::AreEqual(1, fired);
+        }
+    };
 }
@@ -0,0 +1,242 @@
+// Linux-only tests for ConnectionMux, driven over socketpairs and a local listener.
+// Built by the top-level CMakeLists.txt and run through ctest.
+#include "drive.h"
+#include "mux.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Records every frame a mux hands to its handler, keyed by connection id.
+struct FrameLog {
+    std::mutex lock;
+    std::map<int, std::vector<Frame>> frames;
+
+    FrameHandler Handler() {
+        return [this](Frame& frame) {
+            std::lock_guard<std::mutex> guard(lock);
+            frames[frame.connId].push_back(frame);
+        };
+    }
+
+    int Count() {
+        std::lock_guard<std::mutex> guard(lock);
+        int count = 0;
+        for (auto& entry : frames)
+            count += static_cast<int>(entry.second.size());
+        return count;
+    }
+};
+
+// Polls 'done' for up to two seconds.
+static bool WaitFor(std::function<bool()> done) {
+    for (int i = 0; i < 200; i++) {
+        if (done())
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return done();
+}
+
+// Builds a 9-byte DRIVE frame carrying 'count' as its packet count.
+static std::string DriveFrame(int count) {
+    pktdef packet;
+    packet.SetPktCount(count);
+    packet.SetCmd(DRIVE);
+    char driveInput[] = "1,10,90";
+    packet.SetBodyData(driveInput, sizeof(driveInput));
+    char* buf = packet.GenPacket();
+    std::string frame(buf, PACKET_SIZE);
+    delete[] buf;
+    return frame;
+}
+
+static bool WriteAll(int fd, const std::string& data) {
+    return write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+}
+
+// Test that frames from many connections arrive complete and in per-connection order,
+// even when the bytes are split across writes.
+static void FrameOrderTest() {
+    const int connections = 50;
+    const int frames = 20;
+    FrameLog log;
+    ConnectionMux mux(3, 4, log.Handler());
+    mux.Start();
+
+    std::vector<int> peers;
+    std::vector<int> ids;
+    for (int i = 0; i < connections; i++) {
+        int sv[2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        ids.push_back(mux.AddConnection(sv[0]));
+        peers.push_back(sv[1]);
+    }
+    for (int n = 0; n < frames; n++) {
+        std::string frame = DriveFrame(n);
+        for (int fd : peers) {
+            CHECK(WriteAll(fd, frame.substr(0, 4)));
+            CHECK(WriteAll(fd, frame.substr(4)));
+        }
+    }
+
+    CHECK(WaitFor([&] { return log.Count() == connections * frames; }));
+    mux.Stop();
+    for (int id : ids) {
+        std::vector<Frame>& received = log.frames[id];
+        CHECK(static_cast<int>(received.size()) == frames);
+        for (int n = 0; n < static_cast<int>(received.size()); n++) {
+            CHECK(received[n].length == PACKET_SIZE);
+            CHECK(received[n].packet.GetPktCount() == n);
+        }
+    }
+    for (int fd : peers)
+        close(fd);
+}
+
+// Test that closing the peer delivers one close event after the connection's frames,
+// and that a reused descriptor number gets a new connection id.
+static void CloseEventTest() {
+    FrameLog log;
+    ConnectionMux mux(1, 1, log.Handler());
+    mux.Start();
+
+    std::vector<int> ids;
+    for (int i = 0; i < 2; i++) {
+        int sv[2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        int id = mux.AddConnection(sv[0]);
+        ids.push_back(id);
+        CHECK(WriteAll(sv[1], DriveFrame(i)));
+        close(sv[1]);
+        CHECK(WaitFor([&] { return mux.GetConnectionCount() == 0; }));
+    }
+    mux.Stop();
+
+    CHECK(ids[0] != ids[1]);
+    for (int id : ids) {
+        std::vector<Frame>& received = log.frames[id];
+        CHECK(received.size() == 2);
+        if (received.size() == 2) {
+            CHECK(received[0].length == PACKET_SIZE);
+            CHECK(received[1].length == CLOSE_EVENT);
+        }
+    }
+}
+
+// Test that an undefined pktlength closes the connection and the peer sees EOF.
+static void BadLengthTest() {
+    FrameLog log;
+    ConnectionMux mux(1, 1, log.Handler());
+    mux.Start();
+
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    int id = mux.AddConnection(sv[0]);
+    char raw[HEADERSIZE] = { 1, 0, 0, 42, 0 };
+    CHECK(write(sv[1], raw, HEADERSIZE) == HEADERSIZE);
+
+    CHECK(WaitFor([&] { return log.Count() == 1; }));
+    mux.Stop();
+    CHECK(log.frames[id].size() == 1 && log.frames[id][0].length == CLOSE_EVENT);
+    char byte;
+    CHECK(read(sv[1], &byte, 1) == 0);
+    close(sv[1]);
+}
+
+// Test that Stop() followed by Start() keeps the connection and delivers bytes
+// that arrived while the mux was stopped.
+static void RestartTest() {
+    FrameLog log;
+    ConnectionMux mux(1, 1, log.Handler());
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    mux.AddConnection(sv[0]);
+
+    mux.Start();
+    CHECK(WriteAll(sv[1], DriveFrame(0)));
+    CHECK(WaitFor([&] { return log.Count() == 1; }));
+    mux.Stop();
+
+    CHECK(WriteAll(sv[1], DriveFrame(1)));
+    mux.Start();
+    CHECK(WriteAll(sv[1], DriveFrame(2)));
+    CHECK(WaitFor([&] { return log.Count() == 3; }));
+    mux.Stop();
+
+    CHECK(log.Count() == 3);
+    CHECK(mux.GetConnectionCount() == 1);
+    close(sv[1]);
+}
+
+// Test that a listener adopts every client and each gets its own connection id.
+static void ListenerAcceptTest() {
+    const int clients = 10;
+    FrameLog log;
+    ConnectionMux mux(2, 2, log.Handler());
+
+    // Abstract socket name, so nothing is left on disk.
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "muxtest-%d", static_cast<int>(getpid()));
+    socklen_t addrLength = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1));
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(bind(listener, reinterpret_cast<sockaddr*>(&addr), addrLength) == 0);
+    CHECK(listen(listener, clients) == 0);
+    CHECK(mux.AddListener(listener));
+    mux.Start();
+
+    std::vector<int> sockets;
+    for (int i = 0; i < clients; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        CHECK(connect(fd, reinterpret_cast<sockaddr*>(&addr), addrLength) == 0);
+        CHECK(WriteAll(fd, DriveFrame(i)));
+        sockets.push_back(fd);
+    }
+
+    CHECK(WaitFor([&] { return log.Count() == clients; }));
+    CHECK(mux.GetConnectionCount() == clients);
+    mux.Stop();
+    CHECK(static_cast<int>(log.frames.size()) == clients);
+    for (int fd : sockets)
+        close(fd);
+}
+
+int main() {
+    struct {
+        const char* name;
+        void (*run)();
+    } tests[] = {
+        { "FrameOrderTest", FrameOrderTest },
+        { "CloseEventTest", CloseEventTest },
+        { "BadLengthTest", BadLengthTest },
+        { "RestartTest", RestartTest },
+        { "ListenerAcceptTest", ListenerAcceptTest },
+    };
+    for (auto& test : tests) {
+        int before = failures;
+        test.run();
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", test.name);
+    }
+    return failures == 0 ? 0 : 1;
+}